@@ -1,52 +1,201 @@
-#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-#define SERVER_IP "127.0.0.1"   // IP of the server
-#define SERVER_PORT 3333        // Port of the server
+#define SERVER_IP "127.0.0.1"   // Default IP of the server
+#define SERVER_PORT "3333"      // Default port of the server
 #define MESG_SIZE 9000          // Size of messages
+#define BATCH_WINDOW 64         // Maximum commands awaiting a response in batch mode
+#define WAIT_POLL_INTERVAL 1    // Seconds between status checks while waiting on handles
 #define OK 0
 #define NO_INPUT 1
 #define TOO_LONG 2
 #define EXIT 3
+#define FORMAT_JSON 0
+#define FORMAT_CSV 1
+
+// Buffer for reassembling null-terminated server responses across reads
+struct RecvBuffer {
+    char data[2*MESG_SIZE];
+    int len;
+};
 
 static int getLine(char *prompt, char *buffer, int size);
+static int connectToServer(char *host, char *port);
+static int extractMessage(struct RecvBuffer *buf, char mesg[], int size);
+static int readMessage(int socket, struct RecvBuffer *buf, char mesg[], int size);
+static int runInteractive(int socket, struct RecvBuffer *buf);
+static int runBatch(int socket, struct RecvBuffer *buf, FILE *in, int format, int wait);
+static int waitForHandles(int socket, struct RecvBuffer *buf, int handles[], int numHandles,
+                          int *seq, int format);
+static void printResult(int seq, char cmd[], char mesg[], int format);
+static void printEscaped(char str[], int format);
 
 /***************************************************************************************************
  * Main function
  **************************************************************************************************/
 int main(int argc, char* argv[]) {
     int clientSocket;
-    struct sockaddr_in server;
-    char mesgOut[MESG_SIZE];
     char mesgIn[MESG_SIZE];
+    char *host = SERVER_IP;
+    char *port = SERVER_PORT;
+    char *batchFile = NULL;
+    int format = FORMAT_JSON;
+    int wait = 0;
     int rc = 0;
-    char prompt[] = "Enter command> ";
-    int bytesRead = 0;
-    
-    // Create socket to connect to local machine server via TCP on port 3333
-    clientSocket = socket(AF_INET, SOCK_STREAM, 0);
-    if (clientSocket == -1) {
-        printf("Could not create socket.\n");
-    }
-    bzero(&server, sizeof(server));
-    server.sin_addr.s_addr = inet_addr(SERVER_IP);
-    server.sin_family = AF_INET;
-    server.sin_port = htons(SERVER_PORT);
-    // Connect
-    if (connect(clientSocket, (struct sockaddr*)&server, sizeof(server)) < 0) {
-        printf("Connection error.\n");
-        return 1;
+    int opt;
+    FILE *in = stdin;
+    struct RecvBuffer recvBuf;
+    
+    // Parse options
+    while ((opt = getopt(argc, argv, "s:p:b:f:w")) != -1) {
+        switch (opt) {
+            case 's':
+                host = optarg;
+                break;
+            case 'p':
+                port = optarg;
+                break;
+            case 'b':
+                batchFile = optarg;
+                break;
+            case 'w':
+                wait = 1;
+                break;
+            case 'f':
+                if (strcmp(optarg, "json") == 0) {
+                    format = FORMAT_JSON;
+                }
+                else if (strcmp(optarg, "csv") == 0) {
+                    format = FORMAT_CSV;
+                }
+                else {
+                    fprintf(stderr, "Unknown format '%s', expected json or csv.\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-s server] [-p port] [-b file|-] [-f json|csv] [-w]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+    if (batchFile && (strcmp(batchFile, "-") != 0)) {
+        if ((in = fopen(batchFile, "r")) == NULL) {
+            perror(batchFile);
+            return 1;
+        }
+    }
+    // Connect to server via TCP
+    if ((clientSocket = connectToServer(host, port)) < 0) {
+        fprintf(stderr, "Connection error.\n");
+        return 1;
     }
+    recvBuf.len = 0;
     // Receive initial message
-    read(clientSocket, mesgIn, MESG_SIZE);
-    if (strlen(mesgIn) <= 0) {
-        printf("Failed to receieve data.\n");
+    if (readMessage(clientSocket, &recvBuf, mesgIn, MESG_SIZE) <= 0) {
+        fprintf(stderr, "Failed to receieve data.\n");
+        close(clientSocket);
+        return 1;
+    }
+    
+    if (batchFile) {
+        rc = runBatch(clientSocket, &recvBuf, in, format, wait);
+        if (in != stdin) {
+            fclose(in);
+        }
+        close(clientSocket);
+    }
+    else {
+        printf("%s\n", mesgIn);
+        rc = runInteractive(clientSocket, &recvBuf);
+        close(clientSocket);
+        puts("\nDisconnected.\n");
+    }
+    
+    return rc;
+}
+
+/* Resolves server address and connects, returns socket or -1
+ **************************************************************************************************/
+static int connectToServer(char *host, char *port) {
+    struct addrinfo hints;
+    struct addrinfo *result;
+    struct addrinfo *rp;
+    int sock = -1;
+    
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &result) != 0) {
+        return -1;
+    }
+    for (rp = result; rp; rp = rp->ai_next) {
+        if ((sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol)) == -1) {
+            continue;
+        }
+        if (connect(sock, rp->ai_addr, rp->ai_addrlen) == 0) {
+            break;
+        }
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(result);
+    
+    return sock;
+}
+
+/* Moves the first complete response out of buf into mesg. Returns 1 if one was available
+ **************************************************************************************************/
+static int extractMessage(struct RecvBuffer *buf, char mesg[], int size) {
+    char *end = memchr(buf->data, '\0', buf->len);
+    int mesgLen;
+    
+    // A response too big for the buffer is handed over as is
+    if ((end == NULL) && (buf->len < sizeof(buf->data))) {
+        return 0;
+    }
+    mesgLen = end ? (end - buf->data) : buf->len;
+    if (mesgLen > size - 1) {
+        mesgLen = size - 1;
     }
-    printf("%s\n", mesgIn);
+    memcpy(mesg, buf->data, mesgLen);
+    mesg[mesgLen] = '\0';
+    // Drop response and its terminator from buffer
+    mesgLen = end ? (end - buf->data) + 1 : buf->len;
+    buf->len -= mesgLen;
+    memmove(buf->data, buf->data + mesgLen, buf->len);
+    
+    return 1;
+}
+
+/* Reads until a complete response is received. Returns 1 on success, 0 if server disconnected
+ **************************************************************************************************/
+static int readMessage(int socket, struct RecvBuffer *buf, char mesg[], int size) {
+    int bytesRead;
+    
+    while (!extractMessage(buf, mesg, size)) {
+        bytesRead = read(socket, buf->data + buf->len, sizeof(buf->data) - buf->len);
+        if (bytesRead <= 0) {
+            return 0;
+        }
+        buf->len += bytesRead;
+    }
+    
+    return 1;
+}
+
+/* Prompts for commands and prints the server's response to each
+ **************************************************************************************************/
+static int runInteractive(int socket, struct RecvBuffer *buf) {
+    char mesgOut[MESG_SIZE];
+    char mesgIn[MESG_SIZE];
+    char prompt[] = "Enter command> ";
+    int rc = 0;
     
     while (1) {
         // Clear memory buffers
@@ -54,7 +203,7 @@ int main(int argc, char* argv[]) {
         memset(mesgOut, '\0', MESG_SIZE*sizeof(char));
         
         // Get input and validate
-        rc = getLine(prompt, mesgOut, MESG_SIZE);
+        rc = getLine(prompt, mesgOut, MESG_SIZE - 1);
         if (rc == NO_INPUT) {
             printf("No input\n");
             continue;
@@ -67,22 +216,234 @@ int main(int argc, char* argv[]) {
             break;
         }
         else {
-            // Write to server
-            send(clientSocket, mesgOut, strlen(mesgOut), MSG_NOSIGNAL);
+            // Write newline terminated command to server
+            strcat(mesgOut, "\n");
+            send(socket, mesgOut, strlen(mesgOut), MSG_NOSIGNAL);
         }
         
         // Read from server
-        if ((bytesRead = read(clientSocket, mesgIn, MESG_SIZE)) == 0) {
-            continue;
+        if (!readMessage(socket, buf, mesgIn, MESG_SIZE)) {
+            printf("Server closed the connection.\n");
+            return 1;
         }
         printf("%s", mesgIn);
     }
-    close(clientSocket);
-    puts("\nDisconnected.\n");
     
     return 0;
 }
 
+/* Sends commands read from in without waiting for each response, up to BATCH_WINDOW at a time.
+ * Responses come back in order, so each one is matched to the oldest outstanding command.
+ * If wait is set, the connection is kept open until every handle returned by pingSites is done,
+ * since the server cancels a client's queued websites once it disconnects
+ **************************************************************************************************/
+static int runBatch(int socket, struct RecvBuffer *buf, FILE *in, int format, int wait) {
+    char *pending[BATCH_WINDOW];        // Commands awaiting a response, oldest at pendingHead
+    int pendingHead = 0;
+    int numPending = 0;
+    char line[MESG_SIZE];
+    char mesgIn[MESG_SIZE];
+    char outBuf[MESG_SIZE];             // Command being written to server
+    int outLen = 0;
+    int outSent = 0;
+    int inputDone = 0;
+    int seq = 0;
+    int lineNum = 0;
+    int bytes;
+    int len;
+    int ch;
+    int rc = 0;
+    int *handles = NULL;                // Handles returned by pingSites
+    int numHandles = 0;
+    int handle;
+    char *handleMesg;
+    struct pollfd pfd;
+    
+    if (format == FORMAT_CSV) {
+        printf("seq,command,response\n");
+    }
+    while (!inputDone || numPending) {
+        // Queue the next command once the previous one is fully written
+        while (!inputDone && (outSent == outLen) && (numPending < BATCH_WINDOW)) {
+            if (fgets(line, sizeof(line) - 1, in) == NULL) {
+                inputDone = 1;
+                break;
+            }
+            lineNum++;
+            len = strlen(line);
+            // Skip lines that don't fit in a command rather than sending them in pieces
+            if ((line[len-1] != '\n') && ((ch = fgetc(in)) != '\n') && (ch != EOF)) {
+                while (((ch = fgetc(in)) != '\n') && (ch != EOF));
+                fprintf(stderr, "Line %d is too long, skipped.\n", lineNum);
+                continue;
+            }
+            // Trim line, skip blank lines and comments
+            while ((len > 0) && ((line[len-1] == '\n') || (line[len-1] == '\r'))) {
+                line[--len] = '\0';
+            }
+            if ((len == 0) || (line[0] == '#')) {
+                continue;
+            }
+            if (strcmp(line, "exit") == 0) {
+                inputDone = 1;
+                break;
+            }
+            pending[(pendingHead + numPending) % BATCH_WINDOW] = strdup(line);
+            numPending++;
+            outLen = snprintf(outBuf, sizeof(outBuf), "%s\n", line);
+            outSent = 0;
+        }
+        if (numPending == 0) {
+            continue;
+        }
+        // Wait until server can take more input or has responses
+        pfd.fd = socket;
+        pfd.events = POLLIN | ((outSent < outLen) ? POLLOUT : 0);
+        if (poll(&pfd, 1, -1) < 0) {
+            perror("poll");
+            return 1;
+        }
+        if (pfd.revents & POLLOUT) {
+            bytes = send(socket, outBuf + outSent, outLen - outSent, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (bytes > 0) {
+                outSent += bytes;
+            }
+        }
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+            bytes = read(socket, buf->data + buf->len, sizeof(buf->data) - buf->len);
+            if (bytes <= 0) {
+                fprintf(stderr, "Server closed the connection with %d commands pending.\n",
+                        numPending);
+                return 1;
+            }
+            buf->len += bytes;
+            // Print every response received so far
+            while (numPending && extractMessage(buf, mesgIn, MESG_SIZE)) {
+                // Remember handles to wait on
+                handleMesg = strstr(mesgIn, "Your handle for this request is: ");
+                if (wait && handleMesg
+                    && (sscanf(handleMesg, "Your handle for this request is: %d", &handle) == 1)) {
+                    handles = realloc(handles, (numHandles + 1) * sizeof(int));
+                    handles[numHandles++] = handle;
+                }
+                printResult(++seq, pending[pendingHead], mesgIn, format);
+                free(pending[pendingHead]);
+                pendingHead = (pendingHead + 1) % BATCH_WINDOW;
+                numPending--;
+            }
+        }
+    }
+    if (numHandles) {
+        rc = waitForHandles(socket, buf, handles, numHandles, &seq, format);
+        free(handles);
+    }
+    
+    return rc;
+}
+
+/* Polls showHandleStatus for each handle until none of its websites are IN_QUEUE or IN_PROGRESS,
+ * then prints its final status as a record following the batch's own
+ **************************************************************************************************/
+static int waitForHandles(int socket, struct RecvBuffer *buf, int handles[], int numHandles,
+                          int *seq, int format) {
+    char cmd[32];
+    char mesgOut[40];
+    char mesgIn[MESG_SIZE];
+    int numDone = 0;
+    int i;
+    
+    while (numDone < numHandles) {
+        for (i=0; i<numHandles; i++) {
+            // Finished handles are marked with 0
+            if (handles[i] == 0) {
+                continue;
+            }
+            snprintf(cmd, sizeof(cmd), "showHandleStatus %d", handles[i]);
+            snprintf(mesgOut, sizeof(mesgOut), "%s\n", cmd);
+            send(socket, mesgOut, strlen(mesgOut), MSG_NOSIGNAL);
+            if (!readMessage(socket, buf, mesgIn, MESG_SIZE)) {
+                fprintf(stderr, "Server closed the connection while waiting on handles.\n");
+                return 1;
+            }
+            if (strstr(mesgIn, "IN_QUEUE") || strstr(mesgIn, "IN_PROGRESS")) {
+                continue;
+            }
+            printResult(++(*seq), cmd, mesgIn, format);
+            handles[i] = 0;
+            numDone++;
+        }
+        if (numDone < numHandles) {
+            sleep(WAIT_POLL_INTERVAL);
+        }
+    }
+    
+    return 0;
+}
+
+/* Prints one command and its response as a JSON line or CSV record
+ **************************************************************************************************/
+static void printResult(int seq, char cmd[], char mesg[], int format) {
+    char *end;
+    
+    // Trim surrounding blank lines the server adds for interactive use
+    while (*mesg && ((*mesg == '\n') || (*mesg == ' ') || (*mesg == '\t'))) {
+        mesg++;
+    }
+    end = mesg + strlen(mesg);
+    while ((end > mesg) && ((end[-1] == '\n') || (end[-1] == ' ') || (end[-1] == '\t'))) {
+        *--end = '\0';
+    }
+    if (format == FORMAT_CSV) {
+        printf("%d,", seq);
+        printEscaped(cmd, format);
+        printf(",");
+        printEscaped(mesg, format);
+        printf("\n");
+    }
+    else {
+        printf("{\"seq\":%d,\"command\":", seq);
+        printEscaped(cmd, format);
+        printf(",\"response\":");
+        printEscaped(mesg, format);
+        printf("}\n");
+    }
+    fflush(stdout);
+    
+    return;
+}
+
+/* Prints a quoted string, escaped for JSON or CSV
+ **************************************************************************************************/
+static void printEscaped(char str[], int format) {
+    putchar('"');
+    for (; *str; str++) {
+        if (format == FORMAT_CSV) {
+            if (*str == '"') {
+                putchar('"');
+            }
+            putchar(*str);
+        }
+        else if ((*str == '"') || (*str == '\\')) {
+            printf("\\%c", *str);
+        }
+        else if (*str == '\n') {
+            printf("\\n");
+        }
+        else if (*str == '\t') {
+            printf("\\t");
+        }
+        else if ((unsigned char)*str < 0x20) {
+            printf("\\u%04x", (unsigned char)*str);
+        }
+        else {
+            putchar(*str);
+        }
+    }
+    putchar('"');
+    
+    return;
+}
+
 /* Function to get a line from stdin and prevent buffer overflow
  **************************************************************************************************/
 static int getLine(char prompt[], char buffer[], int size) {
@@ -94,7 +455,9 @@ static int getLine(char prompt[], char buffer[], int size) {
         fflush(stdout);
     }
     // Get input
-    fgets(buffer, size, stdin);
+    if (fgets(buffer, size, stdin) == NULL) {
+        return EXIT;
+    }
     // Handle input
     if (strcmp(buffer, "exit\n") == 0) {
         return EXIT;
@@ -1,17 +1,33 @@
+#define _GNU_SOURCE
 #include <arpa/inet.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #define MAX_WEBSITES 10             // Maximum number of Websites to ping per handle
 #define NUM_WORKER_THREADS 5        // Number of worker threads
 #define NUM_PINGS_PER_SITE 10       // Number of times to ping site
+#define PING_INTERVAL 1.0           // Default seconds between pings
+#define ADAPTIVE_MIN_PINGS 3        // Default pings before adaptive mode may stop
+#define ADAPTIVE_MAX_PINGS 20       // Default ping budget per site in adaptive mode
+#define MAX_PINGS_PER_SITE 1000     // Largest ping budget that may be configured
+#define ADAPTIVE_TARGET_PCT 10.0    // Default 95% confidence half-width to stop at, % of avg
+#define ADAPTIVE_MIN_HALF_WIDTH 0.5 // Half-width (ms) that is always close enough
 #define SOCKET_LISTEN_PORT 3333     // Port for listening socket
+#define MAX_DEADLINE 86400          // Longest deadline (seconds) a request may ask for
 #define MESG_SIZE 9000              // Size of messages
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
 
 
 /***************************************************************************************************
@@ -35,6 +51,8 @@ struct SocketData {
 static int handleQueueSize = 0;
 struct HandleNode {
     unsigned int handle;
+    int clientID;                   // Client that submitted the request
+    time_t deadline;                // Time at which unfinished probes expire, 0 if none
     unsigned int pendingWebsiteNodes;
     struct WebsiteNode *websiteHead;
     struct WebsiteNode *firstWebsiteNodeInHandle;
@@ -52,13 +70,34 @@ struct WebsiteNode {
     short avgPing;
     short minPing;
     short maxPing;
-    char status[10];
+    short numPings;                 // Replies received so far
+    short pingBudget;               // Most pings this site may be sent
+    double halfWidth;               // 95% confidence half-width of avgPing in ms, -1 if unknown
+    char status[12];
+    int started;                    // Set once a worker has taken the WebsiteNode
+    int cancelled;                  // Set by cancel command or client disconnect
+    pid_t probePid;                 // PID of in-flight curl/ping, 0 if none
     struct WebsiteNode *nextWebsiteNodeInHandle;
     struct HandleNode *handleNodeParent;
 };
 
+// Probe settings, set from command line
+static int adaptiveProbing = 0;                         // Stop pinging once RTT converges
+static double pingInterval = PING_INTERVAL;             // Seconds between pings
+static int adaptiveMinPings = ADAPTIVE_MIN_PINGS;       // Pings before convergence is checked
+static int adaptiveMaxPings = ADAPTIVE_MAX_PINGS;       // Ping budget per site
+static double adaptiveTargetPct = ADAPTIVE_TARGET_PCT;  // Half-width to stop at, % of avg
+
+// Two-sided 95% Student's t values by degrees of freedom, 1.96 past the end of the table
+static const double tValues95[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
 // Misc. global variables
 static int handleID = 0;                // Handle ID for clients
+static int pingFailureLogged = 0;       // Set once a ping error has been printed
 static int pendingHandleNodes = 0;      // HandleNodes pending for processing
 static int pendingWebsiteNodes = 0;     // WebsiteNodes pending for processing
 
@@ -72,15 +111,57 @@ int pingWebsite(struct WebsiteNode *website);
 void* processRequest(void *arg);
 void printReturnCode(int rc);
 void* connectionHandler(void *sockData);
-int parseWebsiteList(char list[]);
+int parseWebsiteList(char list[], int clientID, int deadline);
 void handleCommand(char cmd[], char arg[], struct SocketData *sockData);
 void getHandleStatus(int handle, char mesgOut[]);
+void sendMessage(int socket, char mesg[]);
+struct HandleNode* findHandleNode(int handle);
+int cancelHandleNode(struct HandleNode *hNode, int queuedOnly);
+void cancelClientHandleNodes(int clientID);
+int isWebsiteNodeDone(struct WebsiteNode *wNode);
+FILE* startProbe(struct WebsiteNode *website, char *argv[]);
+int finishProbe(struct WebsiteNode *website, FILE *fp);
+void stopProbe(struct WebsiteNode *website);
+double getHalfWidth(int numPings, double m2);
 
 /***************************************************************************************************
  * Main
  **************************************************************************************************/
 // Main function
 int main(int argc, char* argv[]) {
+    int opt;
+    
+    // Parse probe settings
+    while ((opt = getopt(argc, argv, "ai:n:m:e:")) != -1) {
+        switch (opt) {
+            case 'a':
+                adaptiveProbing = 1;
+                break;
+            case 'i':
+                pingInterval = atof(optarg);
+                break;
+            case 'n':
+                adaptiveMinPings = atoi(optarg);
+                break;
+            case 'm':
+                adaptiveMaxPings = atoi(optarg);
+                break;
+            case 'e':
+                adaptiveTargetPct = atof(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-a] [-i interval] [-n min] [-m max] [-e percent]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+    // Interval is passed to ping with 3 decimals, so it must not round to 0
+    if ((lround(pingInterval * 1000) < 1) || (adaptiveMinPings < 2)
+        || (adaptiveMaxPings < adaptiveMinPings) || (adaptiveMaxPings > MAX_PINGS_PER_SITE)
+        || (adaptiveTargetPct <= 0)) {
+        fprintf(stderr, "Invalid probe settings.\n");
+        return 1;
+    }
     // Initialize mutex
     pthread_mutexattr_init(&init);
     pthread_mutexattr_settype(&init, PTHREAD_MUTEX_RECURSIVE_NP);
@@ -151,43 +232,74 @@ int main(int argc, char* argv[]) {
 void* connectionHandler(void *sockData) {
     struct SocketData *socketData = (struct SocketData*)sockData;
     int socket = *(int*)socketData->socketDesc;
+    char recvBuf[MESG_SIZE];
     char mesgIn[MESG_SIZE];
     char mesgOut[MESG_SIZE];
     char command[MESG_SIZE];
     char arg[MESG_SIZE];
+    char *lineEnd;
+    int recvLen = 0;
+    int bytesRead;
+    int lineLen;
     int i;
     
+    memset(mesgIn, '\0', MESG_SIZE*sizeof(char));
+    memset(command, '\0', MESG_SIZE*sizeof(char));
+    memset(arg, '\0', MESG_SIZE*sizeof(char));
     // Initial message
     strcpy(mesgOut, "\nYou are connected.\nType 'help' to see available commands.\n");
-    send(socket, mesgOut, strlen(mesgOut), MSG_NOSIGNAL);
-    // Get input from client
-    while ((read(socket, mesgIn, MESG_SIZE)) > 0) {
-        // Parse command from mesgIn
-        for (i=0; i<strlen(mesgIn); i++) {
-            if (*(mesgIn + i) == '\0') {
-                break;
+    sendMessage(socket, mesgOut);
+    // Get input from client. Commands are newline terminated and may be pipelined, so a read can
+    // hold several commands or only part of one
+    while ((bytesRead = read(socket, recvBuf + recvLen, MESG_SIZE - 1 - recvLen)) > 0) {
+        recvLen += bytesRead;
+        // Handle every complete command, or the whole buffer if a command doesn't fit in it
+        while ((lineEnd = memchr(recvBuf, '\n', recvLen)) || (recvLen == MESG_SIZE - 1)) {
+            lineLen = lineEnd ? (lineEnd - recvBuf) : recvLen;
+            memcpy(mesgIn, recvBuf, lineLen);
+            if ((lineLen > 0) && (mesgIn[lineLen-1] == '\r')) {
+                mesgIn[lineLen-1] = '\0';
             }
-            if (isspace(*(mesgIn + i))) {
-                *(command + i) = '\0';
-                break;
+            // Drop command from receive buffer
+            if (lineEnd) {
+                lineLen++;
             }
-            *(command + i) = *(mesgIn + i);
-        }
-        // Skip whitespace
-        i++;
-        // Copy rest of mesgIn into arg
-        memcpy(arg, &mesgIn[i], strlen(mesgIn));
-        // Process information
-        handleCommand(command, arg, socketData);
+            recvLen -= lineLen;
+            memmove(recvBuf, recvBuf + lineLen, recvLen);
+            // Blank lines get no response
+            if (strlen(mesgIn) == 0) {
+                continue;
+            }
+            // Parse command from mesgIn
+            for (i=0; i<strlen(mesgIn); i++) {
+                if (*(mesgIn + i) == '\0') {
+                    break;
+                }
+                if (isspace(*(mesgIn + i))) {
+                    *(command + i) = '\0';
+                    break;
+                }
+                *(command + i) = *(mesgIn + i);
+            }
+            // Skip whitespace
+            i++;
+            // Copy rest of mesgIn into arg
+            if (i < strlen(mesgIn)) {
+                strcpy(arg, &mesgIn[i]);
+            }
+            // Process information
+            handleCommand(command, arg, socketData);
         
-        // Clear memory buffers
-        memset(mesgIn, '\0', MESG_SIZE*sizeof(char));
-        memset(mesgOut, '\0', MESG_SIZE*sizeof(char));
-        memset(command, '\0', MESG_SIZE*sizeof(char));
-        memset(arg, '\0', MESG_SIZE*sizeof(char));
+            // Clear memory buffers
+            memset(mesgIn, '\0', MESG_SIZE*sizeof(char));
+            memset(mesgOut, '\0', MESG_SIZE*sizeof(char));
+            memset(command, '\0', MESG_SIZE*sizeof(char));
+            memset(arg, '\0', MESG_SIZE*sizeof(char));
+        }
     }
-    // Client disconnects
+    // Client disconnects, drop any of its work that hasn't started yet
     printf("Client %d disconnected.\n", socketData->clientID);
+    cancelClientHandleNodes(socketData->clientID);
     free(socketData);
     numOfConnectedClients--;
     
@@ -208,43 +320,78 @@ void handleCommand(char cmd[], char arg[], struct SocketData *sockData) {
     if (strcmp(cmd, "help") == 0) {
         strcpy(mesgOut, ("\nAvailable commands:\n \
         * help - Display this dialog.\n \
-        * pingSites <comma separated URL list>\n \
-        \t- Example: pingSites www.google.com,www.espn.com\n \
+        * pingSites <comma separated URL list> [deadline]\n \
+        \t- Example: pingSites www.google.com,www.espn.com 30\n \
         \t- Up to 10 URLs are supported.\n \
+        \t- Optional deadline in seconds, unfinished sites expire.\n \
         * showHandles - Displays the current pending requests from all clients.\n \
         * showHandleStatus [integer] - (Ex. showHandleStatus 3)\n \
         \t- Lists the websites requested by each client and \n \
-        \t  their current status.\n\n"));
-        send(socket, mesgOut, strlen(mesgOut), MSG_NOSIGNAL);
+        \t  their current status.\n \
+        * cancel <integer> - (Ex. cancel 3)\n \
+        \t- Cancels the queued and in-progress sites of one of\n \
+        \t  your handles.\n\n"));
+        sendMessage(socket, mesgOut);
     }
     else if (strcmp(cmd, "pingSites") == 0) {
-        handle = parseWebsiteList(arg);
+        // Trailing integer after the URL list is the deadline in seconds
+        int deadline = 0;
+        char *lastArg;
+        int len = strlen(arg);
+        while ((len > 0) && isspace(arg[len-1])) {
+            arg[--len] = '\0';
+        }
+        if ((lastArg = strrchr(arg, ' '))) {
+            int i;
+            long value;
+            for (i=1; isdigit(lastArg[i]); i++);
+            if ((i > 1) && (lastArg[i] == '\0')) {
+                errno = 0;
+                value = strtol(lastArg + 1, NULL, 10);
+                if ((errno == ERANGE) || (value < 1) || (value > MAX_DEADLINE)) {
+                    snprintf(mesgOut, MESG_SIZE, "\nDeadline must be between 1 and %d seconds.\n\n",
+                             MAX_DEADLINE);
+                    sendMessage(socket, mesgOut);
+                    return;
+                }
+                deadline = (int)value;
+                *lastArg = '\0';
+            }
+        }
+        // Don't create a HandleNode without WebsiteNodes
+        if (strspn(arg, ", \t") == strlen(arg)) {
+            strcpy(mesgOut, "\nNo websites given.\n\n");
+            sendMessage(socket, mesgOut);
+            return;
+        }
+        handle = parseWebsiteList(arg, sData->clientID, deadline);
         strcpy(temp1, "Your handle for this request is: ");
         strcpy(temp2, "To view status of this request, type\n\t showHandleStatus ");
         snprintf(mesgOut, MESG_SIZE, "\n%s%d\n%s%d\n\n", temp1, handle, temp2, handle);
-        send(socket, mesgOut, strlen(mesgOut), MSG_NOSIGNAL);
+        sendMessage(socket, mesgOut);
     }
     else if (strcmp(cmd, "showHandles") == 0) {
         strcpy(temp1, "Total handles on server: ");
         snprintf(mesgOut, MESG_SIZE, "\n%s%d\n\n", temp1, handleQueueSize);
-        send(socket,mesgOut, strlen(mesgOut), MSG_NOSIGNAL);
+        sendMessage(socket, mesgOut);
     }
     else if (strcmp(cmd, "showHandleStatus") == 0) {
         // If arg is blank, return every handle's status
         if (strlen(arg) == 0) {
             if (handleQueueSize == 0) {
                 strcpy(mesgOut, "\nNothing to show.\n\n");
-                send(socket, mesgOut, strlen(mesgOut), MSG_NOSIGNAL);
+                sendMessage(socket, mesgOut);
                 return;
             }
             int i = 1;
+            mesgOut[0] = '\0';
             while (i <= handleQueueSize) {
                 getHandleStatus(i, temp);
                 strcat(mesgOut, temp);
                 memset(temp, '\0', MESG_SIZE*sizeof(char));
                 i++;
             }
-            send(socket, mesgOut, strlen(mesgOut), MSG_NOSIGNAL);
+            sendMessage(socket, mesgOut);
         }
         // Validate arg is a digit
         else {
@@ -252,18 +399,50 @@ void handleCommand(char cmd[], char arg[], struct SocketData *sockData) {
             for (i=0; i<strlen(arg); i++) {
                 if (!isdigit(arg[i])) {
                     strcpy(mesgOut, "\nArgument is not an integer.\n\n");
-                    send(socket, mesgOut, strlen(mesgOut)+1, MSG_NOSIGNAL);
+                    sendMessage(socket, mesgOut);
                     return;
                 }
             }
             handle = atoi(arg);
             getHandleStatus(handle, mesgOut);
-            send(socket, mesgOut, strlen(mesgOut), MSG_NOSIGNAL);
+            sendMessage(socket, mesgOut);
+        }
+    }
+    else if (strcmp(cmd, "cancel") == 0) {
+        struct HandleNode *hNode;
+        int i;
+        // Validate arg is a digit
+        for (i=0; i<strlen(arg); i++) {
+            if (!isdigit(arg[i])) {
+                break;
+            }
         }
+        if ((strlen(arg) == 0) || (i < strlen(arg))) {
+            strcpy(mesgOut, "\nArgument is not an integer.\n\n");
+            sendMessage(socket, mesgOut);
+            return;
+        }
+        handle = atoi(arg);
+        pthread_mutex_lock(&queueMutex);
+        hNode = findHandleNode(handle);
+        if (hNode == NULL) {
+            strcpy(mesgOut, "\nThis handle doesn't exist.\n\n");
+        }
+        else if (hNode->clientID != sData->clientID) {
+            strcpy(mesgOut, "\nThis handle belongs to another client.\n\n");
+        }
+        else if (cancelHandleNode(hNode, 0) == 0) {
+            strcpy(mesgOut, "\nNothing left to cancel for this handle.\n\n");
+        }
+        else {
+            snprintf(mesgOut, MESG_SIZE, "\nHandle %d cancelled.\n\n", handle);
+        }
+        pthread_mutex_unlock(&queueMutex);
+        sendMessage(socket, mesgOut);
     }
     else {
         strcpy(mesgOut, "\nError: Unrecognized command.\nType 'help'\n\n");
-        send(socket, mesgOut, strlen(mesgOut), MSG_NOSIGNAL);
+        sendMessage(socket, mesgOut);
     }
     // Clear memory buffers
     memset(mesgOut, '\0', MESG_SIZE*sizeof(char));
@@ -274,16 +453,25 @@ void handleCommand(char cmd[], char arg[], struct SocketData *sockData) {
     return;
 }
 
+/* Sends a message to client. The terminating null byte is sent too and marks the end of the
+ * response, so pipelining clients can split responses that arrive in the same read
+ **************************************************************************************************/
+void sendMessage(int socket, char mesg[]) {
+    send(socket, mesg, strlen(mesg)+1, MSG_NOSIGNAL);
+    
+    return;
+}
+
 /* Parses a list of websites entered by client and adds them to queue
  **************************************************************************************************/
-int parseWebsiteList(char list[]) {
+int parseWebsiteList(char list[], int clientID, int deadline) {
     // Parse websites from list into separate URL strings
-    char *parsedURLs[MAX_WEBSITES];
+    char *parsedURLs[MAX_WEBSITES] = {NULL};
     const char *delim = ", \n \0";
     int i = 0;
     char *ptr;
     ptr = strtok(list, delim);
-    while ((ptr) && (i<strlen(list))) {
+    while ((ptr) && (i<MAX_WEBSITES)) {
         parsedURLs[i] = ptr;
         i++;
         ptr = strtok(NULL, delim);
@@ -292,10 +480,16 @@ int parseWebsiteList(char list[]) {
     struct HandleNode *hNode = malloc(sizeof(struct HandleNode));
     handleID++;
     hNode->handle = handleID;
+    hNode->clientID = clientID;
+    hNode->deadline = (deadline > 0) ? time(NULL) + deadline : 0;
     hNode->pendingWebsiteNodes = 0;
+    hNode->websiteHead = NULL;
+    hNode->firstWebsiteNodeInHandle = NULL;
+    hNode->lastWebsiteNodeInHandle = NULL;
+    hNode->nextHandleNodeInQueue = NULL;
     // Create and initialize WebsiteNode
     i = 0;
-    while (parsedURLs[i] && i<10) {
+    while (i<MAX_WEBSITES && parsedURLs[i]) {
         // Create new WebsiteNodes for hNode
         struct WebsiteNode *wNode = malloc(sizeof(struct WebsiteNode));
         if (!wNode) {
@@ -308,7 +502,13 @@ int parseWebsiteList(char list[]) {
         wNode->avgPing = -1;
         wNode->minPing = -1;
         wNode->maxPing = -1;
+        wNode->numPings = 0;
+        wNode->pingBudget = adaptiveProbing ? adaptiveMaxPings : NUM_PINGS_PER_SITE;
+        wNode->halfWidth = -1;
         strcpy(wNode->status, "IN_QUEUE");
+        wNode->started = 0;
+        wNode->cancelled = 0;
+        wNode->probePid = 0;
         wNode->handleNodeParent = hNode;
         // If this is first WebsiteNode
         if (hNode->firstWebsiteNodeInHandle == NULL) {
@@ -350,6 +550,10 @@ void addHandleNodeToQueue(struct HandleNode *hNode) {
         if (handleQueueSize == 0) {
             queueHead = hNode;
         }
+        // Keep drained HandleNodes linked so they can still be looked up by handle
+        else {
+            lastHandleNodeInQueue->nextHandleNodeInQueue = hNode;
+        }
         // Move first and last HandleNode in queue to next available request
         firstHandleNodeInQueue = lastHandleNodeInQueue = hNode;
     }
@@ -442,13 +646,26 @@ void* processRequest(void *t) {
             pthread_cond_wait(&gotRequest, &queueMutex);
         }
         // Website is available for processing, retrieve the first WebsiteNode
+        wNode = NULL;
         if ((hNode = getHandleNodeFromQueue())) {
             if ((wNode = getWebsiteNodeFromHandleNode(hNode))) {
                 //printf("Thread %ld grabbed %s.\n", pthread_self(), wNode->url);
                 pendingWebsiteNodes--;
+                wNode->started = 1;
+                // Skip WebsiteNodes that were cancelled or expired while queued
+                if (wNode->cancelled) {
+                    wNode = NULL;
+                }
+                else if (hNode->deadline && (time(NULL) >= hNode->deadline)) {
+                    strcpy(wNode->status, "EXPIRED");
+                    wNode = NULL;
+                }
             }
         }
         pthread_mutex_unlock(&queueMutex);
+        if (wNode == NULL) {
+            continue;
+        }
         // Prevent pinging NULL wNodes
         if (strlen(wNode->url) > 1) {
             pingWebsite(wNode);
@@ -467,11 +684,79 @@ void printReturnCode(int rc) {
     exit(-1);
 }
 
+/* Finds a HandleNode by its handle, NULL if it doesn't exist. Caller must hold queueMutex
+ **************************************************************************************************/
+struct HandleNode* findHandleNode(int handle) {
+    struct HandleNode *hItr = queueHead;
+    
+    if ((handle > handleQueueSize) || (handle < 1)) {
+        return NULL;
+    }
+    while (hItr && (handle != hItr->handle)) {
+        hItr = hItr->nextHandleNodeInQueue;
+    }
+    
+    return hItr;
+}
+
+/* Returns 1 if WebsiteNode has reached a final status
+ **************************************************************************************************/
+int isWebsiteNodeDone(struct WebsiteNode *wNode) {
+    return (strcmp(wNode->status, "IN_QUEUE") != 0) && (strcmp(wNode->status, "IN_PROGRESS") != 0);
+}
+
+/* Cancels unfinished WebsiteNodes of a HandleNode and returns how many were cancelled. Queued ones
+ * are skipped by the workers when dequeued, in-flight ones have their probe killed so the worker
+ * is freed immediately. If queuedOnly is set, in-flight probes are left to finish.
+ * Caller must hold queueMutex
+ **************************************************************************************************/
+int cancelHandleNode(struct HandleNode *hNode, int queuedOnly) {
+    struct WebsiteNode *wItr;
+    int numCancelled = 0;
+    
+    for (wItr = hNode->websiteHead; wItr; wItr = wItr->nextWebsiteNodeInHandle) {
+        if (wItr->cancelled || isWebsiteNodeDone(wItr)) {
+            continue;
+        }
+        if (queuedOnly && wItr->started) {
+            continue;
+        }
+        wItr->cancelled = 1;
+        if (wItr->probePid > 0) {
+            kill(wItr->probePid, SIGKILL);
+        }
+        // In-flight WebsiteNodes are marked by their worker once the probe exits
+        if (!wItr->started) {
+            strcpy(wItr->status, "CANCELLED");
+        }
+        numCancelled++;
+    }
+    
+    return numCancelled;
+}
+
+/* Cancels the work of a disconnected client that hasn't been started by a worker yet
+ **************************************************************************************************/
+void cancelClientHandleNodes(int clientID) {
+    struct HandleNode *hItr;
+    
+    pthread_mutex_lock(&queueMutex);
+    for (hItr = queueHead; hItr; hItr = hItr->nextHandleNodeInQueue) {
+        if (hItr->clientID == clientID) {
+            cancelHandleNode(hItr, 1);
+        }
+    }
+    pthread_mutex_unlock(&queueMutex);
+    
+    return;
+}
+
 // Returns status of handle requested
 void getHandleStatus(int handle, char mesgOut[]) {
     struct HandleNode *hItr = queueHead;
     struct WebsiteNode *wItr;
     char temp[MESG_SIZE];
+    char halfWidth[16];
     
     // Validate handle is within range
     if ((handle > handleQueueSize) || (handle < 1)) {
@@ -487,19 +772,27 @@ void getHandleStatus(int handle, char mesgOut[]) {
     snprintf(
         temp,
         MESG_SIZE/MAX_WEBSITES,
-        "\n%s\t%s\t\t\t%s\t%s\t%s\t%s\n%s\n",
-        "Handle", "URL", "Avg", "Min", "Max", "Status",
-        "==================================================================="
+        "\n%s\t%s\t\t\t%s\t%s\t%s\t%s\t%s\t%s\n%s\n",
+        "Handle", "URL", "Avg", "Min", "Max", "Pings", "+/-", "Status",
+        "==================================================================================="
     );
     strcpy(mesgOut, temp);
     memset(temp, '\0', MESG_SIZE*sizeof(char));
     while (wItr) {
+        // Half-width is -1 until there are two replies, shown like the other unknown values
+        if (wItr->halfWidth < 0) {
+            strcpy(halfWidth, "-1");
+        }
+        else {
+            snprintf(halfWidth, sizeof(halfWidth), "%.1f", wItr->halfWidth);
+        }
         // Store data for table
         snprintf(
             temp,
             MESG_SIZE/MAX_WEBSITES,
-            "  %d\t%-20.20s\t%d\t%d\t%d\t%-12s\n",
-            handle, wItr->url, wItr->avgPing, wItr->minPing, wItr->maxPing, wItr->status
+            "  %d\t%-20.20s\t%d\t%d\t%d\t%d/%d\t%s\t%-12s\n",
+            handle, wItr->url, wItr->avgPing, wItr->minPing, wItr->maxPing,
+            wItr->numPings, wItr->pingBudget, halfWidth, wItr->status
         );
         strcat(mesgOut, temp);
         memset(temp, '\0', MESG_SIZE*sizeof(char));
@@ -510,86 +803,231 @@ void getHandleStatus(int handle, char mesgOut[]) {
     return;
 }
 
+/* Runs a probe command with its stdout piped back, like popen() but without a shell so the PID can
+ * be recorded on the WebsiteNode and killed by cancelHandleNode()
+ **************************************************************************************************/
+FILE* startProbe(struct WebsiteNode *website, char *argv[]) {
+    int fd[2];
+    int devNull;
+    pid_t pid;
+    
+    if (pipe2(fd, O_CLOEXEC) < 0) {
+        return NULL;
+    }
+    pid = fork();
+    if (pid < 0) {
+        close(fd[0]);
+        close(fd[1]);
+        return NULL;
+    }
+    // Child, send stdout to pipe and discard stderr
+    if (pid == 0) {
+        dup2(fd[1], STDOUT_FILENO);
+        if ((devNull = open("/dev/null", O_WRONLY)) >= 0) {
+            dup2(devNull, STDERR_FILENO);
+        }
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    close(fd[1]);
+    // Publish PID, and kill right away if cancelled while forking
+    pthread_mutex_lock(&queueMutex);
+    website->probePid = pid;
+    if (website->cancelled) {
+        kill(pid, SIGKILL);
+    }
+    pthread_mutex_unlock(&queueMutex);
+    
+    return fdopen(fd[0], "r");
+}
+
+/* Closes probe output, reaps the probe and returns its waitpid() status. PID is cleared before
+ * reaping so it can't be reused by the time cancelHandleNode() sends a signal
+ **************************************************************************************************/
+int finishProbe(struct WebsiteNode *website, FILE *fp) {
+    pid_t pid;
+    int status = 0;
+    
+    fclose(fp);
+    pthread_mutex_lock(&queueMutex);
+    pid = website->probePid;
+    website->probePid = 0;
+    pthread_mutex_unlock(&queueMutex);
+    waitpid(pid, &status, 0);
+    
+    return status;
+}
+
+/* Kills a probe that has gathered enough data, finishProbe() still has to reap it
+ **************************************************************************************************/
+void stopProbe(struct WebsiteNode *website) {
+    pthread_mutex_lock(&queueMutex);
+    if (website->probePid > 0) {
+        kill(website->probePid, SIGTERM);
+    }
+    pthread_mutex_unlock(&queueMutex);
+    
+    return;
+}
+
+/* Returns 95% confidence half-width of the mean RTT, given the sum of squared deviations m2
+ **************************************************************************************************/
+double getHalfWidth(int numPings, double m2) {
+    int df = numPings - 1;
+    double t = (df <= sizeof(tValues95)/sizeof(tValues95[0])) ? tValues95[df-1] : 1.96;
+    
+    return t * sqrt(m2 / df / numPings);
+}
+
 /* A function to ping (/usr/bin/ping) Website and store its data. Need 'curl' and 'ping' installed
  **************************************************************************************************/
 int pingWebsite(struct WebsiteNode *website) {
     FILE *fp;
-    char *validateURLCmd1 = "curl -Is ";        // First part of command for URL validation
-    char *validateURLCmd2 = " | head -n 1";     // Second part of command for URL validation
-    char *ping = "/usr/bin/ping -q -c ";        // Command for pinging
+    char *curlArgs[7];                          // Arguments for URL validation
+    char *pingArgs[11];                         // Arguments for pinging
+    char numPings[12];                          // Ping count argument
+    char interval[16];                          // Ping interval argument
+    char timeLeft[12];                          // Seconds left until deadline
     char output[1000];                          // Output from command
+    char firstLine[1000];                       // First line of output
     char *parsed;                               // For parsing output
     char *err;                                  // For parsing output
-    double pingData[4];                         // Store out ping data
+    double rtt;                                 // Round trip time of one reply
+    double delta;                               // Difference of rtt from mean before update
+    double minRtt = 0;                          // Running RTT statistics
+    double maxRtt = 0;
+    double mean = 0;
+    double m2 = 0;                              // Sum of squared deviations from mean
+    int n = 0;                                  // Replies received
+    int pingStatus;                             // Exit status of ping
+    time_t deadline = website->handleNodeParent->deadline;
     int i;
     
-    // First, check if URL is valid
-    char validateURLCmd[strlen(validateURLCmd1)+strlen(website->url)+strlen(validateURLCmd2)+1];
-    snprintf(
-        validateURLCmd,
-        sizeof(validateURLCmd), 
-        "%s%s%s",
-        validateURLCmd1, website->url, validateURLCmd2
-    );
+    // First, check if URL is valid with "curl -Is <URL>", bounded by the deadline if there is one
+    i = 0;
+    curlArgs[i++] = "curl";
+    curlArgs[i++] = "-Is";
+    if (deadline) {
+        snprintf(timeLeft, sizeof(timeLeft), "%ld", (long)MAX(deadline - time(NULL), 1));
+        curlArgs[i++] = "-m";
+        curlArgs[i++] = timeLeft;
+    }
+    curlArgs[i++] = website->url;
+    curlArgs[i] = NULL;
     // Run curl
-    fp = popen(validateURLCmd, "r");
+    fp = startProbe(website, curlArgs);
     if (fp == NULL) {
         printf("Failed to run curl. Not installed?\n");
         return 0;
     }
     // Collect data and close
+    firstLine[0] = '\0';
     while (fgets(output, sizeof(output), fp) != NULL) {
-        // printf("%s", output);
+        if (firstLine[0] == '\0') {
+            strcpy(firstLine, output);
+        }
     }
-    pclose(fp);
-    // "curl -Is <URL> | head -n 1" returns nothing if URL is invalid
-    if (strlen(output) == 0) {
+    finishProbe(website, fp);
+    if (website->cancelled) {
+        strcpy(website->status, "CANCELLED");
+        return 1;
+    }
+    if (deadline && (time(NULL) >= deadline)) {
+        strcpy(website->status, "EXPIRED");
+        return 1;
+    }
+    // curl returns nothing if URL is invalid
+    if (strlen(firstLine) == 0) {
         strcpy(website->status, "INVALID_URL");
         return 1;
     }
     // If URL is valid, update Website status
     strcpy(website->status, "IN_PROGRESS");
-    // Build command parameters
-    char pingCmd[strlen(ping)+10+strlen(website->url)+1];
-    snprintf(pingCmd, sizeof(pingCmd), "%s %d %s", ping, NUM_PINGS_PER_SITE, website->url);
+    // Build command parameters, ping gives up by itself once the deadline is reached
+    i = 0;
+    snprintf(numPings, sizeof(numPings), "%d", website->pingBudget);
+    snprintf(interval, sizeof(interval), "%.3f", pingInterval);
+    pingArgs[i++] = "/usr/bin/ping";
+    pingArgs[i++] = "-n";
+    pingArgs[i++] = "-c";
+    pingArgs[i++] = numPings;
+    pingArgs[i++] = "-i";
+    pingArgs[i++] = interval;
+    if (deadline) {
+        snprintf(timeLeft, sizeof(timeLeft), "%ld", (long)MAX(deadline - time(NULL), 1));
+        pingArgs[i++] = "-w";
+        pingArgs[i++] = timeLeft;
+    }
+    pingArgs[i++] = website->url;
+    pingArgs[i] = NULL;
     // Run ping
-    fp = popen(pingCmd, "r");
+    fp = startProbe(website, pingArgs);
     if (fp == NULL) {
         printf("Failed to run ping. Not installed?\n");
         return 0;
     }
-    // Collect data and close
-    while (fgets(output, sizeof(output), fp) != NULL) {
-        //printf("%s", output);
-    }
-    pclose(fp);
     
-    /* Parse data. Basically goes through the data and locates the double values we are looking for.
-     * For example, the ping command returns this line at the end:
-     * rtt min/avg/max/mdev = 27.848/31.269/34.939/2.907 ms
-     * Parsing the float values and converting to int will give us the data we need.
+    /* Parse data as each reply arrives. The RTT is taken from every reply line, for example:
+     * 64 bytes from 142.250.72.4: icmp_seq=1 ttl=117 time=27.8 ms
+     * Mean and variance are kept with Welford's method so adaptive mode can stop pinging once the
+     * 95% confidence interval of the mean is narrow enough.
      */
-    err = output;
-    parsed = output;
-    i = 0;
-    while (*parsed) {
-        pingData[i] = strtod(parsed, &err);
+    while (fgets(output, sizeof(output), fp) != NULL) {
+        if ((parsed = strstr(output, "time=")) == NULL) {
+            if ((parsed = strstr(output, "time<")) == NULL) {
+                continue;
+            }
+        }
+        parsed += strlen("time=");
+        rtt = strtod(parsed, &err);
         if (parsed == err) {
-            parsed++;
+            continue;
         }
-        else if ((err == NULL) || (*err == 0)) {
-            break;
+        // Update statistics
+        n++;
+        minRtt = (n == 1) ? rtt : MIN(minRtt, rtt);
+        maxRtt = (n == 1) ? rtt : MAX(maxRtt, rtt);
+        delta = rtt - mean;
+        mean += delta / n;
+        m2 += delta * (rtt - mean);
+        website->numPings = n;
+        if (n > 1) {
+            website->halfWidth = getHalfWidth(n, m2);
         }
-        else {
-            parsed = err + 1;
-            i++;
+        // Stop early once converged, jittery sites keep going up to their budget
+        if (adaptiveProbing && (n >= adaptiveMinPings) && (n < website->pingBudget) && (
+            website->halfWidth <= MAX(mean*adaptiveTargetPct/100, ADAPTIVE_MIN_HALF_WIDTH))) {
+            stopProbe(website);
+            break;
         }
     }
+    pingStatus = finishProbe(website, fp);
+    if (website->cancelled) {
+        strcpy(website->status, "CANCELLED");
+        return 1;
+    }
+    
     // Update Website with acquired data
-    website->minPing = (int)pingData[0];    // Minimum
-    website->avgPing = (int)pingData[1];    // Average
-    website->maxPing = (int)pingData[2];    // Maximum
-    if ((website->minPing == 0) && (website->avgPing == 0) && (website->maxPing == 0)) {
+    if (n > 0) {
+        website->minPing = (int)minRtt;     // Minimum
+        website->avgPing = (int)mean;       // Average
+        website->maxPing = (int)maxRtt;     // Maximum
+    }
+    if (deadline && (time(NULL) >= deadline)) {
+        strcpy(website->status, "EXPIRED");
+    }
+    // ping exits with 1 when no replies came back, anything else means it couldn't ping at all
+    else if ((n == 0) && WIFEXITED(pingStatus) && (WEXITSTATUS(pingStatus) > 1)) {
+        strcpy(website->status, "PING_FAILED");
+        pthread_mutex_lock(&queueMutex);
+        if (!pingFailureLogged) {
+            printf("Failed to run ping, exit status %d. Not installed, or -i too small?\n",
+                   WEXITSTATUS(pingStatus));
+            pingFailureLogged = 1;
+        }
+        pthread_mutex_unlock(&queueMutex);
+    }
+    else if (n == 0) {
         strcpy(website->status, "BLOCKED");
     }
     else {